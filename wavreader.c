@@ -6,35 +6,319 @@
 #include <stdint.h>
 #include <limits.h>
 #include <errno.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
 
 #define SAMPLE_TO_NIBBLE(sample) ((sample & 0xF000) >> 12)
 
+/* Bytes read at a time when streaming, and how many blocks and slices may be
+in flight between stages, and the most samples of each region resynthesized
+from its spectrum. Together they cap the memory of a streamed conversion,
+whatever the size of the file. */
+#define STREAM_BLOCK_SIZE 65536
+#define STREAM_BLOCKS 4
+#define STREAM_CYCLES 16
+#define STREAM_REGION 65536
+
 char * option_input = NULL;
 char * option_output = NULL;
 int option_size = 16;
 int option_count = 16;
 int option_length = 0;
 int option_extend = 0;
+int option_spectral = 0;
+int option_interactive = 0;
+int option_offset = 0;
+int option_threads = 0;
+int option_onsets = 0;
+int option_streaming = 0;
+
+/* Slice starts placed by place_onsets, or NULL for evenly spaced slices. */
+int * onset_startv = NULL;
+
+/* Precomputed tables for spectral resynthesis of regions up to **region**
+samples long into cycles of **cycle** samples. A plan is read-only once created,
+so one plan may be shared by any number of slices. */
+struct spectral_plan{
+	int size; /* Length of the real FFT; a power of two. */
+	int region; /* Longest region the plan accepts. */
+	int cycle; /* Length of the resynthesized cycle. */
+	int scratch_size; /* Floats of scratch space needed per transform. */
+	int * reverse; /* Bit reversal permutation of size / 2 indices. */
+	float * stage_re; /* Butterfly twiddles, contiguous per stage. */
+	float * stage_im;
+	float * split_re; /* Twiddles that split the half length transform. */
+	float * split_im;
+	float * window; /* Hann window of region samples. */
+	float * cycle_cos; /* One period of cosine and sine in cycle steps. */
+	float * cycle_sin;
+};
+
+/* Part of the data chunk decoded by one thread. */
+struct decode_range{
+	int fd;
+	long offset; /* Position of the first byte in the file. */
+	uint16_t * samplev;
+	size_t samplec;
+	int error; /* Value of errno if the range failed, else 0. */
+};
+
+/* Consecutive slices sampled by one thread into their own part of the slice
+table. */
+struct slice_range{
+	const struct spectral_plan * plan;
+	unsigned int wavec;
+	uint16_t * wavev;
+	uint16_t * slicev; /* The whole table, option_size samples per slice. */
+	int first;
+	int last; /* One past the last slice of the range. */
+	int error; /* Value of errno if the range failed, else 0. */
+};
+
+/* Fixed amount of fixed-size slots handed from one producer thread to one
+consumer thread without locks. */
+struct ring{
+	size_t slotc;
+	size_t slot_size;
+	unsigned char * slotv;
+	_Alignas(64) atomic_size_t head; /* Slots published by the producer. */
+	_Alignas(64) atomic_size_t tail; /* Slots released by the consumer. */
+};
+
+/* Part of the data chunk on its way from the reader to the quantizer. */
+struct block{
+	size_t length; /* Bytes read, 0 past the end of the data. */
+	int error; /* Value of errno if reading failed, else 0. */
+	unsigned char bytes [STREAM_BLOCK_SIZE];
+};
+
+/* Sampled slice on its way from the quantizer to the writer. */
+struct cycle{
+	int error; /* Value of errno if the slice could not be made, else 0. */
+	uint16_t samples []; /* option_size samples. */
+};
+
+/* State of a streamed conversion, shared between its stages. */
+struct stream{
+	int fd;
+	long data_start;
+	size_t data_length; /* Bytes of samples up to the last one used. */
+	unsigned int wavec;
+	const struct spectral_plan * plan;
+	float * scratch;
+	uint16_t * windowv; /* Last plan->region samples, wrapping at at. */
+	uint16_t * regionv; /* The window unwrapped, for sampling. */
+	int at;
+	long position; /* Samples consumed so far. */
+	int slice_index; /* Next slice to be sampled. */
+	long end; /* Position at which that slice is complete. */
+	int openc; /* Slices being collected without a plan, from slice_index. */
+	int open_size; /* Slots for as many slices as can be open at once. */
+	uint16_t * pointv; /* option_size points of each slot. */
+	int * filledv; /* Points collected in each slot. */
+	long * startv; /* First sample of the slice in each slot. */
+	long opening; /* First sample of the next slice to open. */
+	struct ring blocks;
+	struct ring cycles;
+};
+
+/* Contents of the terminal as last drawn and as about to be drawn, so only
+cells that differ between the two need to be sent. */
+struct frame{
+	int rows;
+	int cols;
+	char * cells; /* Character of each cell, row by row. */
+	unsigned char * attrs; /* Nonzero for highlighted cells. */
+	char * shown_cells; /* Cells currently on the terminal. */
+	unsigned char * shown_attrs;
+	char * out; /* Escape sequences and text queued for one write. */
+	size_t out_length;
+	size_t out_size;
+};
 
 /* Loads a wave file into memory, writing a pointer to an array of samples into
-**samplev**, and the size of that array into **samplec**. The user is
-resposible for freeing the memory when done.
+**samplev**, the size of that array into **samplec** and the sample rate into
+**rate**. The user is resposible for freeing the memory when done.
 
 Returns 0 on success, 1 if an stdlib function has failed and errno was set, and
 2 if the format of the .wav file is invalid. */
 static int load_waveform(const char * path, int * samplec, uint16_t * *
-samplev);
+samplev, long * rate);
+
+/* Opens a wave file and reads its header, leaving **file** open at the start
+of the samples. Writes the offset of the samples in bytes into **data_start**,
+their length in bytes into **data_length** and the sample rate into **rate**.
+The user is responsible for closing the file when done.
+
+Returns 0 on success, 1 if an stdlib function has failed and errno was set, and
+2 if the format of the .wav file is invalid. The file is closed on failure. */
+static int open_waveform(const char * path, FILE * * file, long * data_start,
+long * data_length, long * rate);
 
 /* Take **length** samples from **wavev** and write them as chars to file. */
 static int write_data(FILE * file, unsigned int wavec, uint16_t * wavev, int
 length);
 
+/* Write the FamiTracker wave sequence that plays each slice of a wave of
+**wavec** samples at **rate** when its audio would, in 60Hz frames. */
+static int write_wave_sequence(FILE * file, unsigned int wavec, long rate);
+
+/* Print the graph and hex of a sampled slice of option_size **cyclev** samples
+unless browsing interactively, and write it to **file** if not NULL. */
+static void output_slice(FILE * file, uint16_t * cyclev);
+
 /* Print the leftmost nibble of **length** **wavev** samples in sequence. */
 static int print_hex(unsigned int wavec, uint16_t * wavev, int length);
 
 /* Print a graph **length** **wavev** samples. */
 static int print_graph(unsigned int wavec, uint16_t * wavev, int length);
 
+/* Run **worker** once for each of **count** consecutive structures of **size**
+bytes at **arguments**, on up to **count** threads, and wait for all of them.
+
+Returns 0 on success and 1 if a thread could not be started and errno was
+set. */
+static int run_workers(void * (* worker)(void *), void * arguments, size_t
+size, int count);
+
+/* Thread count to split work into, from -j or the number of online
+processors. */
+static int thread_count(void);
+
+/* Read and decode one struct decode_range, for run_workers. */
+static void * decode_worker(void * argument);
+
+/* Sample one struct slice_range, for run_workers. */
+static void * slice_worker(void * argument);
+
+/* Write option_count slice starts to **startv**, spread over **wavec**
+**wavev** samples by how much the spectrum changes: dense where the sound
+attacks and sparse where it sustains.
+
+Returns 0 on success and 1 if an stdlib function has failed and errno was
+set. */
+static int place_onsets(unsigned int wavec, uint16_t * wavev, int * startv);
+
+/* Convert the samples of **file**, starting **data_start** bytes in, to slices
+passed to output_slice, without holding all **wavec** samples in memory. A
+reader thread, a quantizer thread and the calling thread as writer run
+concurrently, passing blocks and slices through rings.
+
+Returns 0 on success and 1 if an stdlib function has failed and errno was
+set. */
+static int stream_slices(FILE * file, long data_start, unsigned int wavec,
+const struct spectral_plan * plan, FILE * output);
+
+/* Read the data of a struct stream block by block, for pthread_create. */
+static void * stream_reader(void * argument);
+
+/* Turn the blocks of a struct stream into slices, for pthread_create. */
+static void * stream_quantizer(void * argument);
+
+/* Push one **sample** into the window of **stream**, resynthesizing every slice
+whose analyzed region ends with it. */
+static void stream_sample(struct stream * stream, uint16_t sample);
+
+/* Collect the points that open slices of **stream** take from the next
+**samplec** samples in **bytes**, or from silence if **bytes** is NULL, and
+pass on every slice that is complete. Only used without a plan, so no region
+has to be kept. */
+static void stream_points(struct stream * stream, const unsigned char * bytes,
+long samplec);
+
+/* Return the next sample the slice in slot **slot** of **stream** takes. */
+static long stream_point(const struct stream * stream, int slot);
+
+/* Allocate **slotc** slots of **slot_size** bytes for **ring**.
+
+Returns 0 on success and 1 if an stdlib function has failed and errno was
+set. */
+static int ring_create(struct ring * ring, size_t slotc, size_t slot_size);
+
+/* Free the slots of a ring created by ring_create. */
+static void ring_destroy(struct ring * ring);
+
+/* Wait for a free slot of **ring** and return it, for the producer to fill. */
+static void * ring_claim(struct ring * ring);
+
+/* Hand the claimed slot of **ring** to the consumer. */
+static void ring_publish(struct ring * ring);
+
+/* Wait for a published slot of **ring** and return it, for the consumer. */
+static void * ring_peek(struct ring * ring);
+
+/* Hand the peeked slot of **ring** back to the producer. */
+static void ring_release(struct ring * ring);
+
+/* Back off while waiting on a ring, yielding at first and then sleeping once
+**spins** shows the wait is long, as when reading slow storage. */
+static void ring_wait(int * spins);
+
+/* Return the index of the first sample of slice **slice_index** out of a wave
+of **wavec** samples. */
+static int slice_start(unsigned int wavec, int slice_index);
+
+/* Resample **wavec** **wavev** samples into **length** samples written to
+**cyclev**. If **plan** is not NULL, the region is instead resynthesized from
+its spectrum, using **scratch** as plan->scratch_size floats of working
+memory. */
+static void sample_slice(const struct spectral_plan * plan, float * scratch,
+unsigned int wavec, uint16_t * wavev, int length, uint16_t * cyclev);
+
+/* Prepare **plan** for regions of **region** samples and cycles of **cycle**
+samples.
+
+Returns 0 on success and 1 if an stdlib function has failed and errno was
+set. */
+static int spectral_plan_create(struct spectral_plan * plan, int region, int
+cycle);
+
+/* Free the tables of a plan created by spectral_plan_create. */
+static void spectral_plan_destroy(struct spectral_plan * plan);
+
+/* Transform **plan**->size real samples from **input** into plan->size / 2 + 1
+complex bins written to **re** and **im**. */
+static void fft_real(const struct spectral_plan * plan, const float * input,
+float * re, float * im);
+
+/* Rebuild one period of the fundamental of **wavec** **wavev** samples from its
+first **plan**->cycle / 2 harmonics, writing plan->cycle samples to
+**cyclev**. */
+static void resynthesize(const struct spectral_plan * plan, float * scratch,
+unsigned int wavec, uint16_t * wavev, uint16_t * cyclev);
+
+/* Show slices of **wavec** **wavev** samples in the terminal and let the user
+step through them and adjust option_size, option_length, option_offset and
+option_spectral until they quit.
+
+Returns 0 on success and 1 if an stdlib function has failed and errno was
+set. */
+static int run_interactive(unsigned int wavec, uint16_t * wavev);
+
+/* Size **frame** to **rows** by **cols** cells, blanking it and forgetting
+what is on the terminal.
+
+Returns 0 on success and 1 if an stdlib function has failed and errno was
+set. */
+static int frame_resize(struct frame * frame, int rows, int cols);
+
+/* Write **text** into **frame** starting at **row** and **col**, clipped to the
+frame. */
+static void frame_text(struct frame * frame, int row, int col, int attr, const
+char * text);
+
+/* Send the cells of **frame** that differ from the terminal, moving the cursor
+only where unchanged cells are skipped.
+
+Returns 0 on success and 1 if an stdlib function has failed and errno was
+set. */
+static int frame_flush(struct frame * frame);
+
 /* Return a reasonable starting point for the waveform, to help prevent
 continuity issues. */
 static int center_point(unsigned int wavec, uint16_t * wavev, int length);
@@ -47,17 +331,33 @@ static int center_point(unsigned int wavec, uint16_t * wavev, int length);
 	integer.
 	-l specify length in samples of each slice. Any positive integer.
 	-e extened right edge of rightmost slice to end of audio. Boolean
-	value. */
+	value.
+	-f resynthesize each slice from the harmonics of its spectrum instead of
+	sampling it directly. Boolean value.
+	-t browse slices interactively before writing the output file. Boolean
+	value.
+	-j specify amount of threads to decode and sample with. Any positive
+	integer, defaults to the amount of online processors.
+	-a place slices at the onsets of the audio instead of evenly, and write
+	their timing as a wave sequence. Boolean value.
+	-p stream the file through the conversion instead of loading it whole.
+	Boolean value. */
 int main(int argc, char * * argv){
 	int error = EXIT_FAILURE;
 	FILE * output_file = NULL;
 
-	unsigned int wavec;
-	uint16_t * wavev;
+	FILE * input_file = NULL;
+	long data_start;
+	unsigned int wavec = 0;
+	uint16_t * wavev = NULL;
+	long rate;
+	uint16_t * slicev = NULL;
+	struct spectral_plan plan;
+	struct slice_range * rangev = NULL;
 
 	/* Parse options. */
-	for(int option = 0; (option = getopt(argc, argv, "i:o:s:c:l:e")) != -1;
-	){
+	for(int option = 0; (option = getopt(argc, argv,
+	"i:o:s:c:l:eftj:ap")) != -1;){
 		size_t optarg_length;
 		switch(option){
 			case 'i':
@@ -123,12 +423,41 @@ int main(int argc, char * * argv){
 			case 'e':
 				option_extend = 1;
 				break;
+			case 'f':
+				option_spectral = 1;
+				break;
+			case 't':
+				option_interactive = 1;
+				break;
+			case 'a':
+				option_onsets = 1;
+				break;
+			case 'p':
+				option_streaming = 1;
+				break;
+			case 'j':
+				errno = 0;
+				option_threads = (int) strtol(optarg, NULL, 0);
+				if(errno){
+					fprintf(stderr, "Invalid value given "
+					"for option: -%c.\n",
+					option);
+					goto EXIT;
+				}
+				if(option_threads < 1){
+					fprintf(stderr, "Invalid value given "
+					"for option: -%c.\n",
+					option);
+					goto EXIT;
+				}
+				break;
 			default: /* '?' */
 				fprintf(stderr, "Usage: %s [-i <input "
 				"filepath>] [-s <length of generated "
 				"waveforms>] [-c <amount of slices>] [-l "
 				"<samples per slice>] [-n <instrument "
-				"number>] [-m]\n",
+				"number>] [-m] [-f] [-t] [-j <threads>] [-a] "
+				"[-p]\n",
 				argv[0]);
 				error = EXIT_SUCCESS;
 				goto EXIT;
@@ -142,9 +471,25 @@ int main(int argc, char * * argv){
 		goto EXIT;
 	}
 
-	/* Load waveform. */
+	/* Browsing and onsets need the whole file at hand. */
+	if(option_streaming && (option_interactive || option_onsets)){
+		fprintf(stderr, "Option -p cannot be combined with -t or "
+		"-a.\n");
+		goto EXIT;
+	}
+
+	/* Load waveform, or only its header when streaming. */
 	do{
-		int load_error = load_waveform(option_input, &wavec, &wavev);
+		int load_error;
+		if(option_streaming){
+			long data_length;
+			load_error = open_waveform(option_input, &input_file,
+			&data_start, &data_length, &rate);
+			wavec = data_length / sizeof(uint16_t);
+		}else{
+			load_error = load_waveform(option_input, &wavec,
+			&wavev, &rate);
+		}
 		if(load_error == 1){
 			if(errno == ENOENT)
 				fprintf(stderr, "Nonexistent file: %s\n",
@@ -177,60 +522,110 @@ int main(int argc, char * * argv){
 		}
 	}
 
-	/* Print graphs. */
-	do{
-		for(int slice_index = 0; slice_index < option_count;
-		slice_index++){
-			if(option_extend){
-				print_graph(option_length, wavev + (wavec *
-				slice_index / option_count) + (option_length
-				- (wavec * slice_index / option_count)) *
-				(slice_index / option_count), option_size);
-				print_hex(option_length, wavev + (wavec *
-				slice_index / option_count) + (option_length -
-				(wavec * slice_index / option_count)) *
-				(slice_index / option_count), option_size);
-			}else{
-				print_graph(option_length, wavev + (wavec *
-				slice_index / option_count), option_size);
-				print_hex(option_length, wavev + (wavec *
-				slice_index /	option_count), option_size);
-			}
+	/* Place slices at the onsets of the audio. */
+	if(option_onsets){
+		onset_startv = malloc(sizeof(int) * option_count);
+		if(!onset_startv){perror(NULL); goto FREE_WAVEFORM;}
+		if(place_onsets(wavec, wavev, onset_startv)){
+			perror(NULL);
+			goto FREE_WAVEFORM;
+		}
+	}
+
+	/* Let the user settle on options before anything is generated. */
+	if(option_interactive){
+		if(run_interactive(wavec, wavev)){
+			perror(NULL);
+			goto FREE_WAVEFORM;
+		}
+	}
 
-			printf("\n");
+	/* Prepare the spectral plan, shared by every slice. When streaming,
+	only the start of each region is kept to keep memory bounded. */
+	if(option_spectral){
+		int region = option_length;
+		if(option_streaming && region > STREAM_REGION)
+			region = STREAM_REGION;
+		if(option_length < 4 || option_size < 1){
+			fprintf(stderr, "Spectral resynthesis needs at least 4 "
+			"samples per slice.\n");
+			goto FREE_WAVEFORM;
+		}
+		if(spectral_plan_create(&plan, region, option_size)){
+			perror(NULL);
+			goto FREE_WAVEFORM;
 		}
-	} while(0);
+	}
 
-	/* Write to output file. */
+	/* Start the output file. */
 	if(option_output){
 		output_file = fopen(option_output, "w");
-		if(!output_file){perror(NULL); goto FREE_WAVEFORM;}
+		if(!output_file){perror(NULL); goto FREE_SLICES;}
 
 		fprintf(output_file, "FTI2.4");
 		fprintf(output_file, "%c", 5);
 		fprintf(output_file, "%c%c%c%c", 14, 0, 0, 0);
 		fprintf(output_file, "New Instrument");
-		fprintf(output_file, "%c%c%c%c%c%c", 5, 0, 0, 0, 0, 0);
+		if(option_onsets){
+			fprintf(output_file, "%c%c%c%c%c", 5, 0, 0, 0, 0);
+			write_wave_sequence(output_file, wavec, rate);
+		}else{
+			fprintf(output_file, "%c%c%c%c%c%c", 5, 0, 0, 0, 0, 0);
+		}
 		fprintf(output_file, "%c%c%c%c", option_size, 0, 0, 0);
 		fprintf(output_file, "%c%c%c%c", 0, 0, 0, 0);
 		fprintf(output_file, "%c%c%c%c", option_count, 0, 0, 0);
+	}
 
-		for(int slice_index = 0; slice_index < option_count;
-		slice_index++){
-			if(option_extend){
-				write_data(output_file, option_length, wavev +
-				(wavec * slice_index / option_count) +
-				(option_length - (wavec * slice_index /
-				option_count)) * (slice_index / option_count),
-				option_size);
-			}else{
-				write_data(output_file, option_length, wavev +
-				(wavec * slice_index / option_count),
-				option_size);
-			}
+	/* Stream slices straight from the file to the outputs. */
+	if(option_streaming){
+		if(stream_slices(input_file, data_start, wavec, option_spectral
+		? &plan : NULL, output_file)){
+			perror(NULL);
+			goto CLOSE_FILE;
 		}
+		error = EXIT_SUCCESS;
+		goto CLOSE_FILE;
 	}
 
+	/* Sample every slice into a table of option_size samples each. Each
+	thread fills its own run of slices, so the table is the same whatever
+	the thread count. */
+	do{
+		int rangec = thread_count();
+		if(rangec > option_count) rangec = option_count;
+		slicev = malloc(sizeof(uint16_t) * option_count * option_size);
+		rangev = malloc(sizeof(struct slice_range) * rangec);
+		if(!slicev || !rangev){perror(NULL); goto CLOSE_FILE;}
+		for(int range = 0; range < rangec; range++){
+			rangev[range] = (struct slice_range) {
+				.plan = option_spectral ? &plan : NULL,
+				.wavec = wavec,
+				.wavev = wavev,
+				.slicev = slicev,
+				.first = (long) option_count * range / rangec,
+				.last = (long) option_count * (range + 1) /
+				rangec,
+			};
+		}
+		if(run_workers(slice_worker, rangev, sizeof(struct
+		slice_range), rangec)){
+			perror(NULL);
+			goto CLOSE_FILE;
+		}
+		for(int range = 0; range < rangec; range++){
+			if(rangev[range].error){
+				errno = rangev[range].error;
+				perror(NULL);
+				goto CLOSE_FILE;
+			}
+		}
+	}while(0);
+
+	/* Print graphs and write waveforms. */
+	for(int slice_index = 0; slice_index < option_count; slice_index++)
+		output_slice(output_file, slicev + slice_index * option_size);
+
 	error = EXIT_SUCCESS;
 
 	/* Unwinding allocations. */
@@ -242,8 +637,19 @@ int main(int argc, char * * argv){
 		}
 	}
 
+	FREE_SLICES:
+	free(rangev);
+	free(slicev);
+	if(option_spectral) spectral_plan_destroy(&plan);
 	FREE_WAVEFORM:
+	free(onset_startv);
 	free(wavev);
+	if(input_file){
+		if(fclose(input_file)){
+			perror(NULL);
+			exit(1);
+		}
+	}
 	EXIT:
 	return error;
 }
@@ -257,6 +663,43 @@ wave_index]));
 	}
 }
 
+static void output_slice(FILE * file, uint16_t * cyclev){
+	if(!option_interactive){
+		print_graph(option_size, cyclev, option_size);
+		print_hex(option_size, cyclev, option_size);
+
+		printf("\n");
+	}
+	if(file) write_data(file, option_size, cyclev, option_size);
+}
+
+static int write_wave_sequence(FILE * file, unsigned int wavec, long rate){
+	/* Sequences hold at most 252 frames. */
+	int last = slice_start(wavec, option_count - 1) + option_length;
+	int framec = ((long long) last * 60 + rate - 1) / rate;
+	if(framec < 1) framec = 1;
+	if(framec > 252){
+		fprintf(stderr, "Wave sequence cut to 252 frames; slices "
+		"starting after %.1f seconds will not play.\n", 252.0 / 60);
+		framec = 252;
+	}
+
+	fprintf(file, "%c", 1);
+	fprintf(file, "%c%c%c%c", framec, 0, 0, 0);
+	fprintf(file, "%c%c%c%c", 255, 255, 255, 255); /* No loop. */
+	fprintf(file, "%c%c%c%c", 255, 255, 255, 255); /* No release. */
+	fprintf(file, "%c%c%c%c", 0, 0, 0, 0);
+
+	/* Each frame plays the latest slice to have started by then. */
+	for(int frame = 0, slice_index = 0; frame < framec; frame++){
+		long long sample = (long long) frame * rate / 60;
+		while(slice_index < option_count - 1 && slice_start(wavec,
+		slice_index + 1) <= sample) slice_index++;
+		fprintf(file, "%c", slice_index);
+	}
+	return 0;
+}
+
 static int print_hex(unsigned int wavec, uint16_t * wavev, int length){
 	const char * hex [16] = {"0 ", "1 ", "2 ", "3 ", "4 ", "5 ", "6 ",
 	"7 ", "8 ", "9 ", "10", "11", "12", "13", "14", "15"};
@@ -284,8 +727,8 @@ static int print_graph(unsigned int wavec, uint16_t * wavev, int length){
 
 }
 
-static int load_waveform(const char * path, int * samplec, uint16_t * *
-samplev){
+static int open_waveform(const char * path, FILE * * file, long * data_start,
+long * data_length, long * rate){
 /* Takes a pointer and reads four bytes following that pointer as though it
 were a little-endian unsigned 32-bit integer. */
 #define READ_UINT32(buf) ((uint32_t) *((uint8_t *) (buf)) + (uint32_t) (*( \
@@ -297,37 +740,37 @@ were a little-endian unsigned 32-bit integer. */
 	char buffer [41];
 
 	/* Open file. */
-	FILE * file = fopen(path, "r");
-	if(!file) return 1;
+	*file = fopen(path, "r");
+	if(!*file) return 1;
 
 	/* Find file size. */
 	long size;
-	if(fseek(file, 0, SEEK_END) == -1) {error = 1; goto CLOSE;}
-	if((size = ftell(file)) == -1) {error = 1; goto CLOSE;}
-	if(fseek(file, 0, SEEK_SET) == -1) {error = 1; goto CLOSE;}
+	if(fseek(*file, 0, SEEK_END) == -1) {error = 1; goto CLOSE;}
+	if((size = ftell(*file)) == -1) {error = 1; goto CLOSE;}
+	if(fseek(*file, 0, SEEK_SET) == -1) {error = 1; goto CLOSE;}
 
 	/* Read the RIFF header. */
 	long chunk_size;
 	if(size < 8) {error = 2; goto CLOSE;}
-	if(!fgets(buffer, 9, file)) {error = 1; goto CLOSE;}
+	if(!fgets(buffer, 9, *file)) {error = 1; goto CLOSE;}
 	if(READ_UINT32(&buffer[0]) != 0x46464952) {error = 2; goto CLOSE;}
 	chunk_size = READ_UINT32(&buffer[4]);
 
 	/* Assert that the RIFF chunk has a WAVE identifier. */
 	if(chunk_size < 4) {error = 2; goto CLOSE;}
-	if(!fgets(buffer, 5, file)) {error = 1; goto CLOSE;}
+	if(!fgets(buffer, 5, *file)) {error = 1; goto CLOSE;}
 	if(READ_UINT32(&buffer[0]) != 0x45564157) {error = 2; goto CLOSE;}
 
 	/* Read the format header. */
 	long fmt_chunk_size;
 	if(chunk_size < 12) {error = 2; goto CLOSE;}
-	if(!fgets(buffer, 9, file)) {error = 1; goto CLOSE;}
+	if(!fgets(buffer, 9, *file)) {error = 1; goto CLOSE;}
 	if(READ_UINT32(&buffer[0]) != 0x20746d66) {error = 2; goto CLOSE;}
 
 	fmt_chunk_size = READ_UINT32(&buffer[4]);
 	/* Read the format. */
 	if(fmt_chunk_size < 16) {error = 2; goto CLOSE;}
-	if(!fgets(buffer, fmt_chunk_size + 1, file)) {error = 1; goto CLOSE;}
+	if(!fgets(buffer, fmt_chunk_size + 1, *file)) {error = 1; goto CLOSE;}
 	int fmt_code = READ_UINT16(&buffer[0]);
 	int channels = READ_UINT16(&buffer[2]);
 	long sample_rate = READ_UINT32(&buffer[4]);
@@ -338,38 +781,79 @@ were a little-endian unsigned 32-bit integer. */
 	if(channels != 1) {error = 2; goto CLOSE;}
 	if(align != 2) {error = 2; goto CLOSE;}
 	if(bits_per_sample != 16) {error = 2; goto CLOSE;}
+	if(!sample_rate) {error = 2; goto CLOSE;}
 
-	/* Read the data. */
-	long data_length;
-	long data_start;
-	if(!fgets(buffer, 9, file)) {error = 1; goto CLOSE;}
+	/* Find the data. */
+	if(!fgets(buffer, 9, *file)) {error = 1; goto CLOSE;}
 	if(READ_UINT32(&buffer[0]) != 0x61746164) {error = 2; goto CLOSE;}
-	data_length = READ_UINT32(&buffer[4]);
-	if(!data_length) {error = 2; goto CLOSE;}
-	if((data_start = ftell(file)) == -1) {error = 1; goto CLOSE;}
+	*data_length = READ_UINT32(&buffer[4]);
+	if(!*data_length) {error = 2; goto CLOSE;}
+	if((*data_start = ftell(*file)) == -1) {error = 1; goto CLOSE;}
+	*rate = sample_rate;
+	return 0;
+
+	CLOSE:
+	if(fclose(*file)){
+		perror("open_waveform");
+		exit(1);
+	}
+	return error;
+#undef READ_UINT32
+#undef READ_UINT16
+}
+
+static int load_waveform(const char * path, int * samplec, uint16_t * *
+samplev, long * rate){
+	FILE * file;
+	long data_start;
+	long data_length;
+	int error = open_waveform(path, &file, &data_start, &data_length, rate);
+	if(error) return error;
 
 	/* Allocate data array. */
 	int samples_length = data_length / sizeof(uint16_t);
 	uint16_t * samples = malloc(data_length);
 	if(!samples){error = 1; goto CLOSE;}
 
-	/* Load raw bytes into samples array. */
-	if(fread(samples, sizeof(char), data_length, file) != data_length){
+	/* Split the samples into ranges aligned to whole pages of the array,
+	and have each thread read and decode its own. */
+	const size_t page = 4096 / sizeof(uint16_t);
+	size_t pagec = (samples_length + page - 1) / page;
+	int rangec = thread_count();
+	if(rangec > pagec) rangec = pagec ? pagec : 1;
+	struct decode_range * rangev = malloc(sizeof(struct decode_range) *
+	rangec);
+	if(!rangev){error = 1; goto DEALLOC;}
+	for(int range = 0; range < rangec; range++){
+		size_t first = pagec * range / rangec * page;
+		size_t last = pagec * (range + 1) / rangec * page;
+		if(last > samples_length) last = samples_length;
+		rangev[range] = (struct decode_range) {
+			.fd = fileno(file),
+			.offset = data_start + first * sizeof(uint16_t),
+			.samplev = samples + first,
+			.samplec = last - first,
+		};
+	}
+	if(run_workers(decode_worker, rangev, sizeof(struct decode_range),
+	rangec)){
 		error = 1;
+		free(rangev);
 		goto DEALLOC;
 	}
-
-	/* Reinterpret each pair of bytes as an unsigned short. */
-	for(unsigned int index = 0; index < data_length / sizeof(uint16_t);
-	index++){
-		samples[index] = READ_UINT16(samples + index) + UINT16_MAX / 2
-+ 1;
+	for(int range = 0; range < rangec; range++){
+		if(rangev[range].error){
+			errno = rangev[range].error;
+			error = 1;
+		}
 	}
+	free(rangev);
+	if(error) goto DEALLOC;
 
 	/* Write and return. */
 	*samplec = samples_length;
 	*samplev = samples;
-	return 0;
+	goto CLOSE;
 
 	DEALLOC:
 	free(samples);
@@ -379,389 +863,1131 @@ were a little-endian unsigned 32-bit integer. */
 		exit(1);
 	}
 	return error;
-#undef READ_UINT32
-#undef READ_UINT16
-}#include <unistd.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <math.h>
-#include <stdint.h>
-#include <limits.h>
-#include <errno.h>
+}
 
-#define SAMPLE_TO_NIBBLE(sample) ((sample & 0xF000) >> 12)
+static int slice_start(unsigned int wavec, int slice_index){
+	long start = (long long) wavec * slice_index / option_count;
+	if(onset_startv){
+		start = onset_startv[slice_index];
+	}else if(option_extend){
+		start += (option_length - start) * (slice_index / option_count);
+	}
 
-char * option_input = NULL;
-char * option_output = NULL;
-int option_size = 16;
-int option_count = 16;
-int option_length = 0;
-int option_extend = 0;
+	/* Keep the whole slice inside the wave. */
+	start += option_offset;
+	if(option_length <= wavec && start > (long) wavec - option_length)
+		start = wavec - option_length;
+	if(start < 0) start = 0;
+	return start;
+}
 
-/* Loads a wave file into memory, writing a pointer to an array of samples into
-**samplev**, and the size of that array into **samplec**. The user is
-resposible for freeing the memory when done.
+static void sample_slice(const struct spectral_plan * plan, float * scratch,
+unsigned int wavec, uint16_t * wavev, int length, uint16_t * cyclev){
+	if(plan){
+		resynthesize(plan, scratch, wavec, wavev, cyclev);
+		return;
+	}
+	for(int index = 0; index < length; index++)
+		cyclev[index] = wavev[wavec * index / length];
+}
 
-Returns 0 on success, 1 if an stdlib function has failed and errno was set, and
-2 if the format of the .wav file is invalid. */
-static int load_waveform(const char * path, int * samplec, uint16_t * *
-samplev);
+static int spectral_plan_create(struct spectral_plan * plan, int region, int
+cycle){
+	const double tau = 6.283185307179586;
+	int size = 4;
+	while(size < region) size *= 2;
+	int half = size / 2;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->size = size;
+	plan->region = region;
+	plan->cycle = cycle;
+	plan->scratch_size = size + 2 * (half + 1) + 2 * (cycle / 2 + 1);
+
+	plan->reverse = malloc(sizeof(int) * half);
+	plan->stage_re = malloc(sizeof(float) * half);
+	plan->stage_im = malloc(sizeof(float) * half);
+	plan->split_re = malloc(sizeof(float) * half);
+	plan->split_im = malloc(sizeof(float) * half);
+	plan->window = malloc(sizeof(float) * region);
+	plan->cycle_cos = malloc(sizeof(float) * cycle);
+	plan->cycle_sin = malloc(sizeof(float) * cycle);
+	if(!plan->reverse || !plan->stage_re || !plan->stage_im ||
+	!plan->split_re || !plan->split_im || !plan->window || (cycle &&
+	(!plan->cycle_cos || !plan->cycle_sin))){
+		spectral_plan_destroy(plan);
+		return 1;
+	}
 
-/* Take **length** samples from **wavev** and write them as chars to file. */
-static int write_data(FILE * file, unsigned int wavec, uint16_t * wavev, int
-length);
+	/* Bit reversal of the half length complex transform. */
+	int bits = 0;
+	while((1 << bits) < half) bits++;
+	for(int index = 0; index < half; index++){
+		int reversed = 0;
+		for(int bit = 0; bit < bits; bit++)
+			reversed |= ((index >> bit) & 1) << (bits - 1 - bit);
+		plan->reverse[index] = reversed;
+	}
 
-/* Print the leftmost nibble of **length** **wavev** samples in sequence. */
-static int print_hex(unsigned int wavec, uint16_t * wavev, int length);
+	/* The stage combining pairs of span transforms keeps its span twiddles
+	at offset span - 1, so every butterfly loop reads them contiguously. */
+	for(int span = 1; span < half; span *= 2){
+		for(int index = 0; index < span; index++){
+			plan->stage_re[span - 1 + index] = cos(-tau * index /
+			(2 * span));
+			plan->stage_im[span - 1 + index] = sin(-tau * index /
+			(2 * span));
+		}
+	}
 
-/* Print a graph **length** **wavev** samples. */
-static int print_graph(unsigned int wavec, uint16_t * wavev, int length);
+	for(int index = 0; index < half; index++){
+		plan->split_re[index] = cos(-tau * index / size);
+		plan->split_im[index] = sin(-tau * index / size);
+	}
 
-/* Return a reasonable starting point for the waveform, to help prevent
-continuity issues. */
-static int center_point(unsigned int wavec, uint16_t * wavev, int length);
+	for(int index = 0; index < region; index++)
+		plan->window[index] = 0.5 - 0.5 * cos(tau * (index + 0.5) /
+		region);
 
-/* Available options:
-	-i specify input filepath. May be any string.
-	-o specify output filepath. May be any string.
-	-s specify length of printed hex sequence. Any positive integer.
-	-c specify amount of slices to chop the file into. Any positive
-	integer.
-	-l specify length in samples of each slice. Any positive integer.
-	-e extened right edge of rightmost slice to end of audio. Boolean
-	value. */
-int main(int argc, char * * argv){
-	int error = EXIT_FAILURE;
-	FILE * output_file = NULL;
+	for(int index = 0; index < cycle; index++){
+		plan->cycle_cos[index] = cos(tau * index / cycle);
+		plan->cycle_sin[index] = sin(tau * index / cycle);
+	}
 
-	unsigned int wavec;
-	uint16_t * wavev;
+	return 0;
+}
 
-	/* Parse options. */
-	for(int option = 0; (option = getopt(argc, argv, "i:o:s:c:l:e")) != -1;
-	){
-		size_t optarg_length;
-		switch(option){
-			case 'i':
-				optarg_length = strlen(optarg);
-				option_input = malloc(optarg_length + 1);
-				if(!option_input) goto EXIT;
-				strcpy(option_input, optarg);
-				break;
-			case 'o':
-				optarg_length = strlen(optarg);
-				option_output = malloc(optarg_length + 1);
-				if(!option_output) goto EXIT;
-				strcpy(option_output, optarg);
-				break;
-			case 's':
-				errno = 0;
-				option_size = (int) strtol(optarg, NULL, 0);
-				if(errno){
-					fprintf(stderr, "Invalid value given "
-					"for option: -%c.\n",
-					option);
-					goto EXIT;
+static void spectral_plan_destroy(struct spectral_plan * plan){
+	free(plan->reverse);
+	free(plan->stage_re);
+	free(plan->stage_im);
+	free(plan->split_re);
+	free(plan->split_im);
+	free(plan->window);
+	free(plan->cycle_cos);
+	free(plan->cycle_sin);
+}
+
+static void fft_real(const struct spectral_plan * plan, const float * input,
+float * re, float * im){
+	int half = plan->size / 2;
+
+	/* Pack even samples as real and odd samples as imaginary parts of a
+	half length complex sequence, in bit reversed order. */
+	for(int index = 0; index < half; index++){
+		re[plan->reverse[index]] = input[2 * index];
+		im[plan->reverse[index]] = input[2 * index + 1];
+	}
+
+	/* Radix-2 butterflies. Real and imaginary parts live in separate arrays
+	and twiddles are contiguous per stage, so the inner loop vectorizes. */
+	for(int span = 1; span < half; span *= 2){
+		const float * restrict twiddle_re = plan->stage_re + span - 1;
+		const float * restrict twiddle_im = plan->stage_im + span - 1;
+		for(int base = 0; base < half; base += 2 * span){
+			float * restrict low_re = re + base;
+			float * restrict low_im = im + base;
+			float * restrict high_re = re + base + span;
+			float * restrict high_im = im + base + span;
+			for(int index = 0; index < span; index++){
+				float t_re = twiddle_re[index] *
+				high_re[index] - twiddle_im[index] *
+				high_im[index];
+				float t_im = twiddle_re[index] *
+				high_im[index] + twiddle_im[index] *
+				high_re[index];
+				high_re[index] = low_re[index] - t_re;
+				high_im[index] = low_im[index] - t_im;
+				low_re[index] += t_re;
+				low_im[index] += t_im;
+			}
+		}
+	}
+
+	/* Split the half length transform into the spectrum of the real input.
+	Bins index and half - index are rebuilt together, so this works in
+	place. */
+	float nyquist = re[0] - im[0];
+	re[0] += im[0];
+	im[0] = 0;
+	for(int index = 1; index <= half / 2; index++){
+		int mirror = half - index;
+		float even_re = (re[index] + re[mirror]) / 2;
+		float even_im = (im[index] - im[mirror]) / 2;
+		float odd_re = (im[index] + im[mirror]) / 2;
+		float odd_im = (re[mirror] - re[index]) / 2;
+		float t_re = plan->split_re[index] * odd_re -
+		plan->split_im[index] * odd_im;
+		float t_im = plan->split_re[index] * odd_im +
+		plan->split_im[index] * odd_re;
+		re[index] = even_re + t_re;
+		im[index] = even_im + t_im;
+		re[mirror] = even_re - t_re;
+		im[mirror] = t_im - even_im;
+	}
+	re[half] = nyquist;
+	im[half] = 0;
+}
+
+static void resynthesize(const struct spectral_plan * plan, float * scratch,
+unsigned int wavec, uint16_t * wavev, uint16_t * cyclev){
+	int half = plan->size / 2;
+	float * input = scratch;
+	float * re = scratch + plan->size;
+	float * im = re + half + 1;
+	float * cosine = im + half + 1;
+	float * sine = cosine + plan->cycle / 2 + 1;
+
+	/* Window the region, centered on silence, and pad it with zeros. */
+	if(wavec > plan->region) wavec = plan->region;
+	float window_sum = 0;
+	for(unsigned int index = 0; index < wavec; index++){
+		float weight = plan->window[(long long) index * plan->region /
+		wavec];
+		input[index] = weight * ((float) wavev[index] - 32768);
+		window_sum += weight;
+	}
+	for(int index = wavec; index < plan->size; index++) input[index] = 0;
+	fft_real(plan, input, re, im);
+
+	/* The spectrum is no longer needed as input, so reuse input for
+	magnitudes. */
+	float * magnitude = input;
+	int peak = 0;
+	for(int index = 0; index <= half; index++){
+		magnitude[index] = sqrtf(re[index] * re[index] + im[index] *
+		im[index]);
+		if(index > 0 && index < half && magnitude[index] >
+		magnitude[peak]) peak = index;
+	}
+
+	/* Without any tone there is nothing to resynthesize but the offset. */
+	float offset = window_sum > 0 ? re[0] / window_sum : 0;
+	if(!peak || magnitude[peak] <= 0){
+		for(int index = 0; index < plan->cycle; index++)
+			cyclev[index] = offset < -32768 ? 0 : offset > 32767 ?
+			UINT16_MAX : (uint16_t) (offset + 32768);
+		return;
+	}
+
+	/* The window spreads every partial over a main lobe of this many bins
+	each side. A peak that close to DC means the region holds too few
+	periods to tell the fundamental apart, so sample it directly instead. */
+	int lobe = 2 * plan->size / plan->region;
+	if(peak <= lobe){
+		sample_slice(NULL, NULL, wavec, wavev, plan->cycle, cyclev);
+		return;
+	}
+
+	/* Refine the peak between bins, then settle on the lowest subharmonic
+	that still carries a quarter of the peak, in case the strongest partial
+	is not the fundamental. Only a bin that peaks on its own outside the
+	peak's main lobe counts, not the lobe's spill into its neighbours. */
+	float fundamental = peak;
+	if(peak > 1 && peak < half - 1){
+		float left = magnitude[peak - 1];
+		float right = magnitude[peak + 1];
+		float curve = left - 2 * magnitude[peak] + right;
+		if(curve < 0) fundamental += 0.5f * (left - right) / curve;
+	}
+	for(int divisor = 8; divisor > 1; divisor--){
+		int bin = (int) (fundamental / divisor + 0.5f);
+		if(bin < 1 || peak - bin <= lobe) continue;
+		if(magnitude[bin] < magnitude[bin - 1] || magnitude[bin] <
+		magnitude[bin + 1]) continue;
+		if(magnitude[bin] >= magnitude[peak] / 4){
+			fundamental /= divisor;
+			break;
+		}
+	}
+	if(fundamental < 1) fundamental = 1;
+
+	/* Gather amplitude and phase of each harmonic, relative to the phase of
+	the fundamental so every cycle starts on its rising zero crossing. */
+	int harmonics = 0;
+	float base_phase = 0;
+	for(int harmonic = 1; harmonic <= plan->cycle / 2; harmonic++){
+		int bin = (int) (harmonic * fundamental + 0.5f);
+		if(bin >= half) break;
+		float amplitude = 2 * sqrtf(re[bin] * re[bin] + im[bin] *
+		im[bin]) / window_sum;
+		float phase = atan2f(im[bin], re[bin]);
+		if(harmonic == 1) base_phase = phase + 1.5707963f;
+		phase -= harmonic * base_phase;
+		cosine[harmonic] = amplitude * cosf(phase);
+		sine[harmonic] = amplitude * sinf(phase);
+		harmonics = harmonic;
+	}
+
+	/* Inverse transform of the harmonics over one cycle. Cycle lengths
+	are rarely powers of two, so this sums the few harmonics directly using
+	the plan's period tables. */
+	for(int index = 0; index < plan->cycle; index++){
+		float value = offset;
+		int angle = 0;
+		for(int harmonic = 1; harmonic <= harmonics; harmonic++){
+			angle += index;
+			if(angle >= plan->cycle) angle -= plan->cycle;
+			value += cosine[harmonic] * plan->cycle_cos[angle] -
+			sine[harmonic] * plan->cycle_sin[angle];
+		}
+		if(value < -32768) value = -32768;
+		if(value > 32767) value = 32767;
+		cyclev[index] = (uint16_t) (value + 32768);
+	}
+}
+
+static int run_interactive(unsigned int wavec, uint16_t * wavev){
+	const char * digits = "0123456789ABCDEF";
+	int error = 0;
+	struct termios saved;
+	struct termios raw;
+	struct frame frame = {0};
+	struct spectral_plan plan;
+	int planned = 0;
+	float * scratch = NULL;
+	uint16_t * cyclev = NULL;
+	int slice_index = 0;
+	char keys [16];
+	int pending = 0;
+
+	if(!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)){
+		errno = ENOTTY;
+		return 1;
+	}
+
+	/* Read keys one at a time, waking up periodically to notice resizes.
+	Ctrl-C arrives as a key rather than a signal, so quitting with it still
+	restores the terminal. */
+	if(tcgetattr(STDIN_FILENO, &saved)) return 1;
+	raw = saved;
+	raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+	raw.c_cc[VMIN] = 0;
+	raw.c_cc[VTIME] = 2;
+	if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw)) return 1;
+	fflush(stdout);
+	static const char enter [] = "\e[?1049h\e[?25l";
+	static const char leave [] = "\e[0m\e[?25h\e[?1049l";
+	if(write(STDOUT_FILENO, enter, sizeof(enter) - 1) != sizeof(enter) - 1){
+		error = 1;
+		goto RESTORE;
+	}
+
+	for(int done = 0, dirty = 1; !done;){
+		/* Follow the terminal size. */
+		struct winsize size;
+		int rows = 24;
+		int cols = 80;
+		if(!ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) && size.ws_row &&
+		size.ws_col){
+			rows = size.ws_row;
+			cols = size.ws_col;
+		}
+		if(rows != frame.rows || cols != frame.cols){
+			if(frame_resize(&frame, rows, cols)){
+				error = 1;
+				goto RESTORE;
+			}
+			dirty = 1;
+		}
+
+		if(dirty){
+			/* Bring the plan and cycle in line with the options. */
+			if(planned && (!option_spectral || plan.region !=
+			option_length || plan.cycle != option_size)){
+				spectral_plan_destroy(&plan);
+				free(scratch);
+				scratch = NULL;
+				planned = 0;
+			}
+			if(option_spectral && !planned){
+				if(spectral_plan_create(&plan, option_length,
+				option_size)){
+					error = 1;
+					goto RESTORE;
 				}
-				if(option_size < 0){
-					fprintf(stderr, "Invalid value given "
-					"for option: -%c.\n",
-					option);
-					goto EXIT;
+				planned = 1;
+				scratch = malloc(sizeof(float) *
+				plan.scratch_size);
+				if(!scratch){error = 1; goto RESTORE;}
+			}
+			uint16_t * resized = realloc(cyclev, sizeof(uint16_t) *
+			option_size);
+			if(!resized){error = 1; goto RESTORE;}
+			cyclev = resized;
+			int start = slice_start(wavec, slice_index);
+			sample_slice(planned ? &plan : NULL, scratch,
+			option_length, wavev + start, option_size, cyclev);
+
+			/* Draw the next frame. */
+			char line [256];
+			memset(frame.cells, ' ', frame.rows * frame.cols);
+			memset(frame.attrs, 0, frame.rows * frame.cols);
+			snprintf(line, sizeof(line), "slice %d/%d  size %d  "
+			"length %d  offset %d  start %d%s", slice_index + 1,
+			option_count, option_size, option_length,
+			option_offset, start, option_spectral ? "  spectral"
+			: "");
+			frame_text(&frame, 0, 0, 0, line);
+
+			int width = option_size ? frame.cols / option_size : 3;
+			if(width > 3) width = 3;
+			if(width < 1) width = 1;
+			for(int index = 0; index < option_size; index++){
+				int nibble = SAMPLE_TO_NIBBLE(cyclev[index]);
+				for(int y = 15; y >= 0; y--){
+					for(int x = 0; x < width; x++){
+						frame_text(&frame, 16 - y,
+						index * width + x, nibble > y,
+						" ");
+					}
 				}
-				break;
-			case 'c':
-				errno = 0;
-				option_count = (int) strtol(optarg, NULL, 0);
-				if(errno){
-					fprintf(stderr, "Invalid value given "
-					"for option: -%c.\n",
-					option);
-					goto EXIT;
-				}
-				if(option_count < 0){
-					fprintf(stderr, "Invalid value given "
-					"for option: -%c.\n",
-					option);
-					goto EXIT;
-				}
-				break;
-			case 'l':
-				errno = 0;
-				option_length = (int) strtol(optarg, NULL, 0);
-				if(errno){
-					fprintf(stderr, "Invalid value given "
-					"for option: -%c.\n",
-					option);
-					goto EXIT;
-				}
-				if(option_length < 0){
-					fprintf(stderr, "Invalid value given "
-					"for option: -%c.\n",
-					option);
-					goto EXIT;
-				}
-				break;
-			case 'e':
-				option_extend = 1;
-				break;
-			default: /* '?' */
-				fprintf(stderr, "Usage: %s [-i <input "
-				"filepath>] [-s <length of generated "
-				"waveforms>] [-c <amount of slices>] [-l "
-				"<samples per slice>] [-n <instrument "
-				"number>] [-m]\n",
-				argv[0]);
-				error = EXIT_SUCCESS;
-				goto EXIT;
+				line[0] = digits[nibble];
+				line[1] = '\0';
+				frame_text(&frame, 17, index * width, 0,
+				line);
+			}
+
+			frame_text(&frame, 19, 0, 0, "left/right slice  "
+			"-/+ size  [/] length  {/} offset  f spectral  "
+			"q quit");
+			if(frame_flush(&frame)){error = 1; goto RESTORE;}
+			dirty = 0;
 		}
-	}
 
-	/* Print a message if no filename was provided. */
-	if(!option_input){
-		fprintf(stderr, "No filenames were provided. Specify an input "
-		"file with -i.\n");
-		goto EXIT;
+		/* Handle keys, after any escape sequence left incomplete by the
+		last read. */
+		ssize_t keyc = read(STDIN_FILENO, keys + pending, sizeof(keys) -
+		pending);
+		if(keyc == -1){
+			if(errno == EINTR) continue;
+			error = 1;
+			goto RESTORE;
+		}
+		keyc += pending;
+		pending = 0;
+		for(ssize_t index = 0; index < keyc; index++){
+			int step = option_length / 8 ? option_length / 8 : 1;
+			char key = keys[index];
+
+			/* Translate arrow keys. A sequence cut short by the
+			read is kept for the next one. */
+			if(key == '\e' && (index + 1 == keyc || ((keys[index +
+			1] == '[' || keys[index + 1] == 'O') && index + 2 ==
+			keyc))){
+				pending = keyc - index;
+				memmove(keys, keys + index, pending);
+				break;
+			}
+			if(key == '\e' && (keys[index + 1] == '[' || keys[index
+			+ 1] == 'O')){
+				key = keys[index + 2];
+				key = key == 'C' ? 'l' : key == 'D' ? 'h' :
+				key == 'A' ? '+' : key == 'B' ? '-' : 0;
+				index += 2;
+			}
+
+			switch(key){
+				case 'q':
+				case '\x03':
+					done = 1;
+					break;
+				case 'h':
+					if(slice_index > 0) slice_index--;
+					break;
+				case 'l':
+					if(slice_index < option_count - 1)
+						slice_index++;
+					break;
+				case '-':
+					if(option_size > 4) option_size -= 4;
+					break;
+				case '+':
+				case '=':
+					option_size += 4;
+					if(option_size > 252) option_size = 252;
+					break;
+				case '[':
+					if(option_length * 4 / 5 >= 4)
+						option_length = option_length *
+						4 / 5;
+					break;
+				case ']':
+					option_length = option_length * 5 / 4 +
+					1;
+					if(option_length > wavec)
+						option_length = wavec;
+					break;
+				case '{':
+					if(option_offset - step >= -(long)
+					wavec) option_offset -= step;
+					break;
+				case '}':
+					if(option_offset + step <= (long) wavec)
+						option_offset += step;
+					break;
+				case 'f':
+					option_spectral = !option_spectral;
+					break;
+				default:
+					continue;
+			}
+			dirty = 1;
+		}
 	}
 
-	/* Load waveform. */
+	RESTORE:
 	do{
-		int load_error = load_waveform(option_input, &wavec, &wavev);
-		if(load_error == 1){
-			if(errno == ENOENT)
-				fprintf(stderr, "Nonexistent file: %s\n",
-				option_input);
-			else
-				perror(NULL);
-			goto EXIT;
-		}
-		if(load_error == 2){
-			fprintf(stderr, "Unsupported WAV file format: %s\n",
-			option_input);
-			goto EXIT;
+		int saved_errno = errno;
+		if(write(STDOUT_FILENO, leave, sizeof(leave) - 1)){}
+		tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+		if(planned){
+			spectral_plan_destroy(&plan);
+			free(scratch);
 		}
+		free(cyclev);
+		free(frame.cells);
+		free(frame.attrs);
+		free(frame.shown_cells);
+		free(frame.shown_attrs);
+		free(frame.out);
+		errno = saved_errno;
 	}while(0);
+	return error;
+}
 
-	/* Set length to maximum if none was provided. */
-	if(!option_length) option_length = wavec / option_count;
+static int frame_resize(struct frame * frame, int rows, int cols){
+	size_t cellc = (size_t) rows * cols;
+	char * cells = realloc(frame->cells, cellc);
+	if(!cells) return 1;
+	frame->cells = cells;
+	unsigned char * attrs = realloc(frame->attrs, cellc);
+	if(!attrs) return 1;
+	frame->attrs = attrs;
+	cells = realloc(frame->shown_cells, cellc);
+	if(!cells) return 1;
+	frame->shown_cells = cells;
+	attrs = realloc(frame->shown_attrs, cellc);
+	if(!attrs) return 1;
+	frame->shown_attrs = attrs;
+
+	/* The terminal is cleared on the next flush, so it shows blanks. */
+	frame->rows = rows;
+	frame->cols = cols;
+	memset(frame->cells, ' ', cellc);
+	memset(frame->attrs, 0, cellc);
+	memset(frame->shown_cells, ' ', cellc);
+	memset(frame->shown_attrs, 0, cellc);
+	frame->out_length = 0;
+	static const char clear [] = "\e[0m\e[2J";
+	if(frame->out_size < sizeof(clear)){
+		char * out = realloc(frame->out, 4096);
+		if(!out) return 1;
+		frame->out = out;
+		frame->out_size = 4096;
+	}
+	memcpy(frame->out, clear, sizeof(clear) - 1);
+	frame->out_length = sizeof(clear) - 1;
+	return 0;
+}
 
-	/* Throw error if length option is impossible. */
-	if(option_extend){
-		if(option_length > wavec){
-			fprintf(stderr, "Requested audio length is longer "
-			"than file.");
-			goto EXIT;
+static void frame_text(struct frame * frame, int row, int col, int attr, const
+char * text){
+	if(row < 0 || row >= frame->rows) return;
+	for(; *text && col < frame->cols; text++, col++){
+		if(col < 0) continue;
+		frame->cells[row * frame->cols + col] = *text;
+		frame->attrs[row * frame->cols + col] = attr;
+	}
+}
+
+static int frame_flush(struct frame * frame){
+	/* At worst every cell needs a cursor move, a color and itself. */
+	size_t needed = frame->out_length + (size_t) frame->rows * frame->cols *
+	32 + 16;
+	if(frame->out_size < needed){
+		char * out = realloc(frame->out, needed);
+		if(!out) return 1;
+		frame->out = out;
+		frame->out_size = needed;
+	}
+
+	char * out = frame->out + frame->out_length;
+	int cursor_row = -1;
+	int cursor_col = -1;
+	int attr = 0;
+	for(int row = 0; row < frame->rows; row++){
+		for(int col = 0; col < frame->cols; col++){
+			int cell = row * frame->cols + col;
+			if(frame->cells[cell] == frame->shown_cells[cell] &&
+			frame->attrs[cell] == frame->shown_attrs[cell])
+				continue;
+
+			/* Skipped cells and the pending wrap after the last
+			column both need the cursor moved explicitly, unless a
+			few unchanged cells can be sent again more cheaply. */
+			if(row != cursor_row || col != cursor_col){
+				int gap = row == cursor_row && cursor_col >= 0 ?
+				col - cursor_col : INT_MAX;
+				for(int skipped = 0; gap <= 6 && skipped < gap;
+				skipped++){
+					if(frame->attrs[cell - gap + skipped] !=
+					attr) gap = INT_MAX;
+				}
+				if(gap <= 6){
+					memcpy(out, frame->cells + cell - gap,
+					gap);
+					out += gap;
+				}else{
+					out += sprintf(out, "\e[%d;%dH", row +
+					1, col + 1);
+				}
+			}
+			if(frame->attrs[cell] != attr){
+				attr = frame->attrs[cell];
+				out += sprintf(out, attr ? "\e[37;47m" :
+				"\e[0m");
+			}
+			*out++ = frame->cells[cell];
+			cursor_row = row;
+			cursor_col = col + 1 < frame->cols ? col + 1 : -1;
+			frame->shown_cells[cell] = frame->cells[cell];
+			frame->shown_attrs[cell] = frame->attrs[cell];
 		}
-	}else{
-		if(option_length > wavec / option_count){
-			fprintf(stderr, "Requested audio length would be "
-			"longer than a slice.");
+	}
+	if(attr) out += sprintf(out, "\e[0m");
+
+	/* Send the whole frame at once. */
+	size_t length = out - frame->out;
+	for(size_t sent = 0; sent < length;){
+		ssize_t written = write(STDOUT_FILENO, frame->out + sent,
+		length - sent);
+		if(written == -1){
+			if(errno == EINTR) continue;
+			return 1;
 		}
+		sent += written;
 	}
+	frame->out_length = 0;
+	return 0;
+}
 
-	/* Print graphs. */
-	do{
-		for(int slice_index = 0; slice_index < option_count;
-		slice_index++){
-			if(option_extend){
-				print_graph(option_length, wavev + (wavec *
-				slice_index / option_count) + (option_length
-				- (wavec * slice_index / option_count)) *
-				(slice_index / option_count), option_size);
-				print_hex(option_length, wavev + (wavec *
-				slice_index / option_count) + (option_length -
-				(wavec * slice_index / option_count)) *
-				(slice_index / option_count), option_size);
-			}else{
-				print_graph(option_length, wavev + (wavec *
-				slice_index / option_count), option_size);
-				print_hex(option_length, wavev + (wavec *
-				slice_index /	option_count), option_size);
-			}
+static int run_workers(void * (* worker)(void *), void * arguments, size_t
+size, int count){
+	pthread_t * threadv = malloc(sizeof(pthread_t) * count);
+	if(!threadv) return 1;
 
-			printf("\n");
-		}
-	} while(0);
+	/* The calling thread takes the first share itself. */
+	int started;
+	int error = 0;
+	for(started = 1; started < count; started++){
+		error = pthread_create(&threadv[started], NULL, worker, (char *)
+		arguments + size * started);
+		if(error) break;
+	}
+	if(count > 0 && !error) worker(arguments);
+	for(int thread = 1; thread < started; thread++)
+		pthread_join(threadv[thread], NULL);
+	free(threadv);
+
+	if(error){
+		errno = error;
+		return 1;
+	}
+	return 0;
+}
 
-	/* Write to output file. */
-	if(option_output){
-		output_file = fopen(option_output, "w");
-		if(!output_file){perror(NULL); goto FREE_WAVEFORM;}
+static int thread_count(void){
+	if(option_threads) return option_threads;
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	return online > 0 ? online : 1;
+}
 
-		fprintf(output_file, "FTI2.4");
-		fprintf(output_file, "%c", 5);
-		fprintf(output_file, "%c%c%c%c", 14, 0, 0, 0);
-		fprintf(output_file, "New Instrument");
-		fprintf(output_file, "%c%c%c%c%c%c", 5, 0, 0, 0, 0, 0);
-		fprintf(output_file, "%c%c%c%c", option_size, 0, 0, 0);
-		fprintf(output_file, "%c%c%c%c", 0, 0, 0, 0);
-		fprintf(output_file, "%c%c%c%c", option_count, 0, 0, 0);
+static void * decode_worker(void * argument){
+	struct decode_range * range = argument;
+	unsigned char * bytes = (unsigned char *) range->samplev;
+	size_t length = range->samplec * sizeof(uint16_t);
+
+	/* Load raw bytes into this part of the samples array. */
+	for(size_t done = 0; done < length;){
+		ssize_t got = pread(range->fd, bytes + done, length - done,
+		range->offset + done);
+		if(got == -1 && errno == EINTR) continue;
+		if(got == -1){range->error = errno; return NULL;}
+		if(got == 0){range->error = EIO; return NULL;}
+		done += got;
+	}
 
-		for(int slice_index = 0; slice_index < option_count;
-		slice_index++){
-			if(option_extend){
-				write_data(output_file, option_length, wavev +
-				(wavec * slice_index / option_count) +
-				(option_length - (wavec * slice_index /
-				option_count)) * (slice_index / option_count),
-				option_size);
-			}else{
-				write_data(output_file, option_length, wavev +
-				(wavec * slice_index / option_count),
-				option_size);
-			}
+	/* Reinterpret each pair of bytes as an unsigned short. */
+	for(size_t index = 0; index < range->samplec; index++){
+		range->samplev[index] = (uint16_t) (bytes[2 * index] | bytes[2 *
+		index + 1] << 8) + UINT16_MAX / 2 + 1;
+	}
+	return NULL;
+}
+
+static void * slice_worker(void * argument){
+	struct slice_range * range = argument;
+	float * scratch = NULL;
+
+	if(range->plan){
+		scratch = malloc(sizeof(float) * range->plan->scratch_size);
+		if(!scratch){range->error = errno; return NULL;}
+	}
+	for(int slice_index = range->first; slice_index < range->last;
+	slice_index++){
+		sample_slice(range->plan, scratch, option_length, range->wavev +
+		slice_start(range->wavec, slice_index), option_size,
+		range->slicev + slice_index * option_size);
+	}
+	free(scratch);
+	return NULL;
+}
+
+static int place_onsets(unsigned int wavec, uint16_t * wavev, int * startv){
+	int error = 0;
+	struct spectral_plan plan;
+	int frame = 1024;
+	while(frame > 4 && frame > wavec) frame /= 2;
+	int hop = frame / 2;
+	int framec = wavec >= frame ? (wavec - frame) / hop + 1 : 1;
+	int bins = frame / 2 + 1;
+
+	if(spectral_plan_create(&plan, frame, 0)) return 1;
+	float * input = malloc(sizeof(float) * frame);
+	float * re = malloc(sizeof(float) * bins);
+	float * im = malloc(sizeof(float) * bins);
+	float * previous = calloc(bins, sizeof(float));
+	float * fluxv = malloc(sizeof(float) * framec);
+	if(!input || !re || !im || !previous || !fluxv){error = 1; goto FREE;}
+	for(int slice_index = 0; slice_index < option_count; slice_index++)
+		startv[slice_index] = 0;
+
+	/* Spectral flux in one pass: how much louder each bin got since the
+	previous frame, on a log scale where a full scale sine is near 100 so
+	that noise barely registers. */
+	float scale = 100.0f / (32768.0f * frame / 4);
+	double total = 0;
+	double squares = 0;
+	for(int index = 0; index < framec; index++){
+		uint16_t * samples = wavev + (long) index * hop;
+		for(int sample = 0; sample < frame; sample++){
+			input[sample] = (long) index * hop + sample < wavec ?
+			plan.window[sample] * ((float) samples[sample] - 32768)
+			: 0;
+		}
+		fft_real(&plan, input, re, im);
+
+		float flux = 0;
+		for(int bin = 0; bin < bins; bin++){
+			float magnitude = log1pf(scale * sqrtf(re[bin] * re[bin]
+			+ im[bin] * im[bin]));
+			if(magnitude > previous[bin])
+				flux += magnitude - previous[bin];
+			previous[bin] = magnitude;
 		}
+		/* The first frame has nothing to change from. */
+		if(!index) flux = 0;
+		fluxv[index] = flux;
+		total += flux;
+		squares += (double) flux * flux;
 	}
 
-	error = EXIT_SUCCESS;
+	/* Noise keeps the flux of every frame above zero, so only flux well
+	above its typical level counts as change. Steady sound only has
+	quantization noise, a small fraction of this scale, which must not
+	count as change however rare it is, so the level is also kept above a
+	fixed least flux that a quiet attack still clears. */
+	const double least_flux = 1;
+	double mean = total / framec;
+	double deviation = sqrt(fmax(squares / framec - mean * mean, 0));
+	double threshold = fmax(mean + 2 * deviation, least_flux);
+	total = 0;
+	for(int index = 0; index < framec; index++){
+		fluxv[index] = fmax(fluxv[index] - threshold, 0);
+		total += fluxv[index];
+	}
 
-	/* Unwinding allocations. */
-	CLOSE_FILE:
-	if(output_file){
-		if(fclose(output_file)){
-			perror(NULL);
-			exit(1);
+	/* Treat the flux, plus a floor that keeps some slices in the sustain,
+	as a density and start slices at equal steps of its running sum. */
+	double floor = total > 0 ? total / framec / 4 : 1;
+	total += floor * framec;
+	double sum = 0;
+	for(int index = 0, slice_index = 0; index < framec && slice_index <
+	option_count; index++){
+		double weight = fluxv[index] + floor;
+		while(slice_index < option_count && sum + weight >= total *
+		slice_index / option_count){
+			double into = (total * slice_index / option_count - sum)
+			/ weight;
+			startv[slice_index++] = (long) index * hop + (long)
+			(into * hop);
 		}
+		sum += weight;
 	}
 
-	FREE_WAVEFORM:
-	free(wavev);
-	EXIT:
+	/* Rounding may leave the last slices without a step of their own. */
+	for(int slice_index = 0; slice_index < option_count; slice_index++){
+		if(slice_index && startv[slice_index] < startv[slice_index - 1])
+			startv[slice_index] = startv[slice_index - 1];
+	}
+
+	FREE:
+	free(input);
+	free(re);
+	free(im);
+	free(previous);
+	free(fluxv);
+	spectral_plan_destroy(&plan);
 	return error;
 }
 
-static int write_data(FILE * file, unsigned int wavec, uint16_t * wavev, int
-length){
-	for(int index = 0; index < length; index++){
-		int wave_index = wavec * index / length;
-		fprintf(file, "%c", (unsigned char) SAMPLE_TO_NIBBLE(wavev[
-wave_index]));
+static int stream_slices(FILE * file, long data_start, unsigned int wavec,
+const struct spectral_plan * plan, FILE * output){
+	int error = 0;
+	int started = 0;
+	pthread_t reader;
+	pthread_t quantizer;
+	struct stream stream = {
+		.fd = fileno(file),
+		.data_start = data_start,
+		.wavec = wavec,
+		.plan = plan,
+	};
+
+	/* Only read as far as the last slice reaches. Without a plan a slice
+	only takes its option_size points, and it is open from its first point
+	to its last, so only slices whose starts fall in between are open along
+	with it. */
+	long needed = 0;
+	stream.open_size = 1;
+	for(int slice_index = 0, next = 0; slice_index < option_count;
+	slice_index++){
+		long end = slice_start(wavec, slice_index);
+		if(plan){
+			end += plan->region;
+		}else{
+			end++;
+			if(option_size > 1){
+				end += (long long) option_length * (option_size
+				- 1) / option_size;
+			}
+			while(next < option_count && slice_start(wavec, next) <
+			end) next++;
+			if(next - slice_index > stream.open_size)
+				stream.open_size = next - slice_index;
+		}
+		if(end > needed) needed = end;
+	}
+	if(needed > wavec) needed = wavec;
+	stream.data_length = needed * sizeof(uint16_t);
+	stream.end = slice_start(wavec, 0) + (plan ? plan->region : 0);
+	stream.opening = option_count ? slice_start(wavec, 0) : LONG_MAX;
+
+	/* Everything the stages use is allocated up front, so memory stays
+	bounded and only reading can fail once they run. */
+	size_t cycle_size = (sizeof(struct cycle) + sizeof(uint16_t) *
+	option_size + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+	if(plan){
+		stream.scratch = malloc(sizeof(float) * plan->scratch_size);
+		stream.windowv = malloc(sizeof(uint16_t) * plan->region);
+		stream.regionv = malloc(sizeof(uint16_t) * plan->region);
+		if(!stream.scratch || !stream.windowv || !stream.regionv){
+			error = 1;
+			goto FREE;
+		}
+		for(int index = 0; index < plan->region; index++)
+			stream.windowv[index] = UINT16_MAX / 2 + 1;
+	}else{
+		stream.pointv = malloc(sizeof(uint16_t) * stream.open_size *
+		option_size);
+		stream.filledv = malloc(sizeof(int) * stream.open_size);
+		stream.startv = malloc(sizeof(long) * stream.open_size);
+		if(!stream.pointv || !stream.filledv || !stream.startv){
+			error = 1;
+			goto FREE;
+		}
+	}
+	if(ring_create(&stream.blocks, STREAM_BLOCKS, sizeof(struct block))){
+		error = 1;
+		goto FREE;
+	}
+	if(ring_create(&stream.cycles, STREAM_CYCLES, cycle_size)){
+		error = 1;
+		goto FREE_BLOCKS;
 	}
-}
 
-static int print_hex(unsigned int wavec, uint16_t * wavev, int length){
-	const char * hex [16] = {"0 ", "1 ", "2 ", "3 ", "4 ", "5 ", "6 ",
-	"7 ", "8 ", "9 ", "10", "11", "12", "13", "14", "15"};
-	for(int index = 0; index < length; index++){
-		int wave_index = wavec * index / length;
-		printf("%s", hex[(unsigned int) SAMPLE_TO_NIBBLE(wavev[
-wave_index])]);
-		if(index < length - 1) printf(" "); else printf("\n");
+	if((errno = pthread_create(&reader, NULL, stream_reader, &stream))){
+		error = 1;
+		goto FREE_CYCLES;
 	}
+	if((errno = pthread_create(&quantizer, NULL, stream_quantizer,
+	&stream))){
+		/* Let the reader run to the end so it can be joined. */
+		int saved_errno = errno;
+		for(int last = 0; !last; ring_release(&stream.blocks)){
+			struct block * block = ring_peek(&stream.blocks);
+			last = block->error || !block->length;
+		}
+		pthread_join(reader, NULL);
+		errno = saved_errno;
+		error = 1;
+		goto FREE_CYCLES;
+	}
+	started = 1;
+
+	/* Write slices as they arrive. */
+	for(int slice_index = 0; slice_index < option_count; slice_index++){
+		struct cycle * cycle = ring_peek(&stream.cycles);
+		if(cycle->error){
+			errno = cycle->error;
+			error = 1;
+			ring_release(&stream.cycles);
+			break;
+		}
+		output_slice(output, cycle->samples);
+		ring_release(&stream.cycles);
+	}
+
+	if(started){
+		int saved_errno = errno;
+		pthread_join(quantizer, NULL);
+		pthread_join(reader, NULL);
+		errno = saved_errno;
+	}
+	FREE_CYCLES:
+	ring_destroy(&stream.cycles);
+	FREE_BLOCKS:
+	ring_destroy(&stream.blocks);
+	FREE:
+	free(stream.scratch);
+	free(stream.windowv);
+	free(stream.regionv);
+	free(stream.pointv);
+	free(stream.filledv);
+	free(stream.startv);
+	return error;
 }
 
-static int print_graph(unsigned int wavec, uint16_t * wavev, int length){
-	for(int y = 15; y >= 0; y--){
-		for(int index = 0; index < length; index++){
-			int wave_index = wavec * index / length;
-			if(SAMPLE_TO_NIBBLE(wavev[wave_index]) > y){
-				printf("\e[37;47m   \e[0m");
-			} else {
-				printf("   ");
+static void * stream_reader(void * argument){
+	struct stream * stream = argument;
+
+	/* Ask for aggressive readahead; a refusal only costs speed. */
+	posix_fadvise(stream->fd, stream->data_start, stream->data_length,
+	POSIX_FADV_SEQUENTIAL);
+
+	/* Stay up to STREAM_BLOCKS blocks ahead of the quantizer. */
+	for(size_t offset = 0;;){
+		struct block * block = ring_claim(&stream->blocks);
+		block->error = 0;
+		block->length = stream->data_length - offset;
+		if(block->length > STREAM_BLOCK_SIZE)
+			block->length = STREAM_BLOCK_SIZE;
+		for(size_t done = 0; done < block->length;){
+			ssize_t got = pread(stream->fd, block->bytes + done,
+			block->length - done, stream->data_start + offset +
+			done);
+			if(got == -1 && errno == EINTR) continue;
+			if(got <= 0){
+				block->error = got ? errno : EIO;
+				break;
 			}
+			done += got;
 		}
-		printf("\n");
-	}
-	
+		offset += block->length;
 
+		int last = block->error || !block->length;
+		ring_publish(&stream->blocks);
+		if(last) return NULL;
+	}
 }
 
-static int load_waveform(const char * path, int * samplec, uint16_t * *
-samplev){
-/* Takes a pointer and reads four bytes following that pointer as though it
-were a little-endian unsigned 32-bit integer. */
-#define READ_UINT32(buf) ((uint32_t) *((uint8_t *) (buf)) + (uint32_t) (*( \
-(unsigned char *) (buf) + 1) << 8) + (uint32_t) (*((unsigned char *) (buf) + \
-2) << 16) + (uint32_t) (*((unsigned char *) (buf) + 3) << 24))
-#define READ_UINT16(buf) ((uint16_t) *((uint8_t *) buf) + (uint16_t) (*( \
-(unsigned char *) (buf) + 1) << 8))
-	int error = 0;
-	char buffer [41];
+static void * stream_quantizer(void * argument){
+	struct stream * stream = argument;
 
-	/* Open file. */
-	FILE * file = fopen(path, "r");
-	if(!file) return 1;
+	for(int last = 0; !last;){
+		struct block * block = ring_peek(&stream->blocks);
+		last = block->error || !block->length;
 
-	/* Find file size. */
-	long size;
-	if(fseek(file, 0, SEEK_END) == -1) {error = 1; goto CLOSE;}
-	if((size = ftell(file)) == -1) {error = 1; goto CLOSE;}
-	if(fseek(file, 0, SEEK_SET) == -1) {error = 1; goto CLOSE;}
+		/* Pass a read error on in place of the next slice. */
+		if(block->error){
+			struct cycle * cycle = ring_claim(&stream->cycles);
+			cycle->error = block->error;
+			ring_publish(&stream->cycles);
+			ring_release(&stream->blocks);
+			return NULL;
+		}
 
-	/* Read the RIFF header. */
-	long chunk_size;
-	if(size < 8) {error = 2; goto CLOSE;}
-	if(!fgets(buffer, 9, file)) {error = 1; goto CLOSE;}
-	if(READ_UINT32(&buffer[0]) != 0x46464952) {error = 2; goto CLOSE;}
-	chunk_size = READ_UINT32(&buffer[4]);
+		if(!stream->plan){
+			stream_points(stream, block->bytes, block->length /
+			sizeof(uint16_t));
+			ring_release(&stream->blocks);
+			continue;
+		}
+		for(size_t index = 0; index + 1 < block->length;){
+			/* Samples before the next region are never sampled. */
+			long skip = stream->end - stream->plan->region -
+			stream->position;
+			if(skip > 0){
+				long left = (block->length - index) /
+				sizeof(uint16_t);
+				if(skip > left) skip = left;
+				stream->position += skip;
+				index += skip * sizeof(uint16_t);
+				continue;
+			}
 
-	/* Assert that the RIFF chunk has a WAVE identifier. */
-	if(chunk_size < 4) {error = 2; goto CLOSE;}
-	if(!fgets(buffer, 5, file)) {error = 1; goto CLOSE;}
-	if(READ_UINT32(&buffer[0]) != 0x45564157) {error = 2; goto CLOSE;}
+			/* Reinterpret a pair of bytes as an unsigned short. */
+			stream_sample(stream, (uint16_t) (block->bytes[index] |
+			block->bytes[index + 1] << 8) + UINT16_MAX / 2 + 1);
+			index += sizeof(uint16_t);
+		}
+		ring_release(&stream->blocks);
+	}
 
-	/* Read the format header. */
-	long fmt_chunk_size;
-	if(chunk_size < 12) {error = 2; goto CLOSE;}
-	if(!fgets(buffer, 9, file)) {error = 1; goto CLOSE;}
-	if(READ_UINT32(&buffer[0]) != 0x20746d66) {error = 2; goto CLOSE;}
+	/* Slices reaching past the end of the file end in silence. */
+	if(!stream->plan)
+		stream_points(stream, NULL, LONG_MAX - stream->position);
+	while(stream->slice_index < option_count)
+		stream_sample(stream, UINT16_MAX / 2 + 1);
+	return NULL;
+}
 
-	fmt_chunk_size = READ_UINT32(&buffer[4]);
-	/* Read the format. */
-	if(fmt_chunk_size < 16) {error = 2; goto CLOSE;}
-	if(!fgets(buffer, fmt_chunk_size + 1, file)) {error = 1; goto CLOSE;}
-	int fmt_code = READ_UINT16(&buffer[0]);
-	int channels = READ_UINT16(&buffer[2]);
-	long sample_rate = READ_UINT32(&buffer[4]);
-	long byte_rate = READ_UINT32(&buffer[8]);
-	int align = READ_UINT16(&buffer[12]);
-	int bits_per_sample = READ_UINT16(&buffer[14]);
-	if(fmt_code != 1) {error = 2; goto CLOSE;}
-	if(channels != 1) {error = 2; goto CLOSE;}
-	if(align != 2) {error = 2; goto CLOSE;}
-	if(bits_per_sample != 16) {error = 2; goto CLOSE;}
+static void stream_sample(struct stream * stream, uint16_t sample){
+	int region = stream->plan->region;
+	stream->windowv[stream->at] = sample;
+	if(++stream->at == region) stream->at = 0;
+	stream->position++;
+
+	while(stream->slice_index < option_count && stream->position >=
+	stream->end){
+		/* The oldest sample of the window is the next one to be
+		replaced. */
+		memcpy(stream->regionv, stream->windowv + stream->at,
+		sizeof(uint16_t) * (region - stream->at));
+		memcpy(stream->regionv + region - stream->at,
+		stream->windowv, sizeof(uint16_t) * stream->at);
+
+		struct cycle * cycle = ring_claim(&stream->cycles);
+		cycle->error = 0;
+		sample_slice(stream->plan, stream->scratch, region,
+		stream->regionv, option_size, cycle->samples);
+		ring_publish(&stream->cycles);
+		if(++stream->slice_index < option_count){
+			stream->end = slice_start(stream->wavec,
+			stream->slice_index) + region;
+		}
+	}
+}
 
-	/* Read the data. */
-	long data_length;
-	long data_start;
-	if(!fgets(buffer, 9, file)) {error = 1; goto CLOSE;}
-	if(READ_UINT32(&buffer[0]) != 0x61746164) {error = 2; goto CLOSE;}
-	data_length = READ_UINT32(&buffer[4]);
-	if(!data_length) {error = 2; goto CLOSE;}
-	if((data_start = ftell(file)) == -1) {error = 1; goto CLOSE;}
+static void stream_points(struct stream * stream, const unsigned char * bytes,
+long samplec){
+	long limit = stream->position + samplec;
+
+	for(;;){
+		/* Pass complete slices on in order. */
+		while(stream->openc){
+			int slot = stream->slice_index % stream->open_size;
+			if(stream->filledv[slot] < option_size) break;
+			struct cycle * cycle = ring_claim(&stream->cycles);
+			cycle->error = 0;
+			memcpy(cycle->samples, stream->pointv + (size_t) slot *
+			option_size, sizeof(uint16_t) * option_size);
+			ring_publish(&stream->cycles);
+			stream->slice_index++;
+			stream->openc--;
+		}
 
-	/* Allocate data array. */
-	int samples_length = data_length / sizeof(uint16_t);
-	uint16_t * samples = malloc(data_length);
-	if(!samples){error = 1; goto CLOSE;}
+		/* Find the next sample any slice takes. */
+		long next = stream->opening;
+		for(int open = 0; open < stream->openc; open++){
+			long point = stream_point(stream, (stream->slice_index +
+			open) % stream->open_size);
+			if(point < next) next = point;
+		}
+		if(next >= limit) break;
+
+		/* A slice opens on its first sample, before taking it. */
+		if(next == stream->opening){
+			int opened = stream->slice_index + stream->openc++;
+			int slot = opened % stream->open_size;
+			stream->startv[slot] = stream->opening;
+			stream->filledv[slot] = 0;
+			stream->opening = opened + 1 < option_count ?
+			slice_start(stream->wavec, opened + 1) : LONG_MAX;
+			continue;
+		}
 
-	/* Load raw bytes into samples array. */
-	if(fread(samples, sizeof(char), data_length, file) != data_length){
-		error = 1;
-		goto DEALLOC;
+		/* Reinterpret a pair of bytes as an unsigned short. */
+		uint16_t sample = UINT16_MAX / 2 + 1;
+		if(bytes){
+			const unsigned char * pair = bytes + (next -
+			stream->position) * sizeof(uint16_t);
+			sample = (uint16_t) (pair[0] | pair[1] << 8) +
+			UINT16_MAX / 2 + 1;
+		}
+		for(int open = 0; open < stream->openc; open++){
+			int slot = (stream->slice_index + open) %
+			stream->open_size;
+			while(stream->filledv[slot] < option_size &&
+			stream_point(stream, slot) == next){
+				stream->pointv[(size_t) slot * option_size +
+				stream->filledv[slot]++] = sample;
+			}
+		}
 	}
+	stream->position = limit;
+}
 
-	/* Reinterpret each pair of bytes as an unsigned short. */
-	for(unsigned int index = 0; index < data_length / sizeof(uint16_t);
-	index++){
-		samples[index] = READ_UINT16(samples + index) + UINT16_MAX / 2
-+ 1;
-	}
+static long stream_point(const struct stream * stream, int slot){
+	if(stream->filledv[slot] >= option_size) return LONG_MAX;
+	return stream->startv[slot] + (long long) option_length *
+	stream->filledv[slot] / option_size;
+}
 
-	/* Write and return. */
-	*samplec = samples_length;
-	*samplev = samples;
+static int ring_create(struct ring * ring, size_t slotc, size_t slot_size){
+	ring->slotv = malloc(slotc * slot_size);
+	if(!ring->slotv) return 1;
+	ring->slotc = slotc;
+	ring->slot_size = slot_size;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
 	return 0;
+}
 
-	DEALLOC:
-	free(samples);
-	CLOSE:
-	if(fclose(file)){
-		perror("load_waveform");
-		exit(1);
+static void ring_destroy(struct ring * ring){
+	free(ring->slotv);
+}
+
+static void * ring_claim(struct ring * ring){
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	for(int spins = 0; head - atomic_load_explicit(&ring->tail,
+	memory_order_acquire) == ring->slotc;) ring_wait(&spins);
+	return ring->slotv + head % ring->slotc * ring->slot_size;
+}
+
+static void ring_publish(struct ring * ring){
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static void * ring_peek(struct ring * ring){
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	for(int spins = 0; atomic_load_explicit(&ring->head,
+	memory_order_acquire) == tail;) ring_wait(&spins);
+	return ring->slotv + tail % ring->slotc * ring->slot_size;
+}
+
+static void ring_release(struct ring * ring){
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static void ring_wait(int * spins){
+	if(++*spins < 64){
+		sched_yield();
+	}else{
+		struct timespec pause = {0, 50000};
+		nanosleep(&pause, NULL);
 	}
-	return error;
-#undef READ_UINT32
-#undef READ_UINT16
 }